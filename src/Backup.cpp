@@ -1,8 +1,12 @@
 #include "Backup.hpp"
 
+#include <algorithm>
+#include <iomanip>
 #include <sstream>
 #include <iostream>
 
+#include "Journal.hpp"
+
 
 namespace backups {
 
@@ -16,10 +20,83 @@ Backup Backup::create(
   backup.id = id;
   backup.location = location;
   backup.algorithm = std::move(algorithm);
+  backup.gc = std::make_unique<GarbageCollector>();
   backup.createRestorePoint(files, false);
   return backup;
 }
 
+Backup Backup::load(std::istream& stream) {
+  Backup backup;
+  std::string location;
+  std::string algorithm;
+  time::Duration::rep creation_time = 0;
+  std::size_t removed_count = 0;
+  std::size_t rp_count = 0;
+  stream >> backup.id >> creation_time >> std::quoted(location) >> std::quoted(algorithm)
+    >> backup.free_rp_id;
+  backup.rp_limit = loadRestorePointLimit(stream);
+  stream >> removed_count;
+  for (std::size_t i = 0; i < removed_count && stream; ++i) {
+    Id rp_id = 0;
+    stream >> rp_id;
+    backup.removed_rp_ids.insert(rp_id);
+  }
+  stream >> rp_count;
+  if (!stream) {
+    throw std::runtime_error("Malformed backup record");
+  }
+  backup.creation_time = time::DateTime{time::Duration{creation_time}};
+  backup.location = location;
+  backup.algorithm = makeBackupAlgorithm(algorithm);
+  backup.gc = std::make_unique<GarbageCollector>();
+  for (std::size_t i = 0; i < rp_count; ++i) {
+    RestorePoint rp;
+    std::string rp_location;
+    std::size_t file_count = 0;
+    stream >> rp.id >> creation_time >> std::quoted(rp_location) >> rp.is_incremental
+      >> rp.size.logical >> rp.size.physical >> file_count;
+    rp.creation_time = time::DateTime{time::Duration{creation_time}};
+    rp.location = rp_location;
+    for (std::size_t j = 0; j < file_count && stream; ++j) {
+      std::string file;
+      stream >> std::quoted(file);
+      rp.files.push_back(file);
+    }
+    if (!stream) {
+      throw std::runtime_error("Malformed restore point record of backup " + std::to_string(backup.id));
+    }
+    backup.size += rp.size;
+    backup.restore_points.push_back(std::move(rp));
+  }
+  return backup;
+}
+
+void Backup::save(std::ostream& stream) const {
+  stream << id << ' '
+    << creation_time.time_since_epoch().count() << ' '
+    << std::quoted(location.string()) << ' '
+    << std::quoted(algorithm->getName()) << ' '
+    << free_rp_id << ' ';
+  rp_limit->save(stream);
+  stream << ' ' << removed_rp_ids.size();
+  for (Id rp_id: removed_rp_ids) {
+    stream << ' ' << rp_id;
+  }
+  stream << ' ' << restore_points.size() << '\n';
+  for (const auto& rp: restore_points) {
+    stream << rp.id << ' '
+      << rp.creation_time.time_since_epoch().count() << ' '
+      << std::quoted(rp.location.string()) << ' '
+      << rp.is_incremental << ' '
+      << rp.size.logical << ' '
+      << rp.size.physical << ' '
+      << rp.files.size() << '\n';
+    for (const auto& file: rp.files) {
+      stream << std::quoted(file.string()) << '\n';
+    }
+  }
+}
+
 Id Backup::getId() const {
   return id;
 }
@@ -32,7 +109,7 @@ time::DateTime Backup::getCreationTime() const {
   return creation_time;
 }
 
-std::size_t Backup::getSize() const {
+StorageSize Backup::getSize() const {
   return size;
 }
 
@@ -42,7 +119,8 @@ std::vector<std::string> Backup::printableList() const {
   list.push_back((SS{} << "id: " << id).str());
   list.push_back((SS{} << "creation time: " << time::toString(creation_time)).str());
   list.push_back((SS{} << "location: " << location).str());
-  list.push_back((SS{} << "size: " << size).str());
+  list.push_back((SS{} << "size: " << size.logical << " logical, " << size.physical << " physical").str());
+  list.push_back((SS{} << "disk usage: " << fs::diskUsage(directory())).str());
   list.push_back((SS{} << "algorithm: " << algorithm->getName()).str());
   list.push_back((SS{} << "limit: " << rp_limit->getDescription()).str());
   list.push_back("restore points:");
@@ -51,7 +129,7 @@ std::vector<std::string> Backup::printableList() const {
     list.push_back((SS{} << "  creation time: " << time::toString(rp.creation_time)).str());
     list.push_back((SS{} << "  location: " << rp.location).str());
     list.push_back((SS{} << "  incremental: " << (rp.is_incremental ? "true" : "false")).str());
-    list.push_back((SS{} << "  size: " << rp.size).str());
+    list.push_back((SS{} << "  size: " << rp.size.logical << " logical, " << rp.size.physical << " physical").str());
     list.push_back("  files:  ");
     for (const auto& file: rp.files) {
       list.push_back((SS{} << "    " << file).str());
@@ -108,9 +186,22 @@ void Backup::removeRestorePoint(Id id) {
   removeRestorePointAt(index);
 }
 
+// Only removes what the backup wrote; the directories above are left in place
+// unless they end up empty.
 void Backup::remove() {
-  fs::remove(location);
+  for (const auto& rp_location: collectedDirectories()) {
+    fs::remove(rp_location);
+  }
+  std::error_code error;
+  std::filesystem::remove(directory() / std::to_string(free_rp_id), error);
+  std::filesystem::remove(directory(), error);
+  std::filesystem::remove(location, error);
   restore_points.clear();
+  removed_rp_ids.clear();
+}
+
+bool Backup::collectGarbage(std::uint64_t io_budget) {
+  return gc->step(io_budget, collectedDirectories());
 }
 
 void Backup::cleanup() {
@@ -127,14 +218,18 @@ void Backup::cleanup() {
 }
 
 Id Backup::createRestorePoint(std::span<fs::Path> files, bool incremental) {
-  Id rp_id = free_rp_id++;
-  fs::Path rp_location = fs::Path{location}.append(std::to_string(rp_id));
-  std::size_t rp_size = 0;
+  // The id is only taken once the point is durable, so a failed attempt is
+  // retried in the same location and resumes from its journal.
+  Id rp_id = free_rp_id;
+  gc->invalidate();
+  fs::Path rp_location = directory() / std::to_string(rp_id);
+  StorageSize rp_size;
   if (restore_points.empty()) {
     rp_size = algorithm->backupFiles(files, rp_location, incremental);
   } else {
     rp_size = algorithm->backupFiles(files, rp_location, incremental, restore_points.back().location);
   }
+  ++free_rp_id;
   size += rp_size;
   restore_points.push_back(std::move(RestorePoint{
     rp_id,
@@ -148,6 +243,7 @@ Id Backup::createRestorePoint(std::span<fs::Path> files, bool incremental) {
 }
 
 void Backup::removeRestorePointAt(std::size_t index) {
+  gc->invalidate();
   auto& restore_point = restore_points[index];
   size -= restore_point.size;
   if (index + 1 < restore_points.size()) {
@@ -159,10 +255,36 @@ void Backup::removeRestorePointAt(std::size_t index) {
       child.is_incremental = restore_point.is_incremental;
     }
   }
-  fs::remove(restore_point.location);
+  algorithm->removeRestorePoint(restore_point.location);
+  removed_rp_ids.insert(restore_point.id);
   restore_points.erase(restore_points.begin() + index);
 }
 
+fs::Path Backup::directory() const {
+  return location / std::to_string(id);
+}
+
+std::vector<fs::Path> Backup::collectedDirectories() {
+  std::vector<fs::Path> directories;
+  for (auto it = removed_rp_ids.begin(); it != removed_rp_ids.end();) {
+    fs::Path rp_location = directory() / std::to_string(*it);
+    if (!std::filesystem::exists(rp_location)) {
+      it = removed_rp_ids.erase(it);
+      continue;
+    }
+    directories.push_back(rp_location.lexically_normal());
+    ++it;
+  }
+  for (const auto& rp: restore_points) {
+    directories.push_back(rp.location.lexically_normal());
+  }
+  fs::Path rp_location = directory() / std::to_string(free_rp_id);
+  if (Journal::exists(rp_location)) {
+    directories.push_back(rp_location.lexically_normal());
+  }
+  return directories;
+}
+
 RestorePoint& Backup::getRestorePoint(Id id) {
   for (auto it = restore_points.begin(); it != restore_points.end(); ++it) {
     if (it->id == id) return *it;
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <iosfwd>
 #include <memory>
 #include <vector>
 #include <span>
 #include <deque>
+#include <set>
 #include <string>
 
 #include "Common.hpp"
@@ -12,6 +14,7 @@
 #include "RestorePointLimit.hpp"
 #include "Time.hpp"
 #include "BackupAlgorithm.hpp"
+#include "GarbageCollector.hpp"
 
 
 namespace backups {
@@ -24,11 +27,13 @@ public:
     const fs::Path& location,
     std::unique_ptr<IBackupAlgorithm> algorithm
   );
+  static Backup load(std::istream& stream);
+  void save(std::ostream& stream) const;
 
   Id getId() const;
   const std::vector<fs::Path>& getFiles() const;
   time::DateTime getCreationTime() const;
-  std::size_t getSize() const;
+  StorageSize getSize() const;
 
   std::vector<std::string> printableList() const;
 
@@ -47,6 +52,8 @@ public:
 
   void cleanup();
 
+  bool collectGarbage(std::uint64_t io_budget);
+
   Backup(const Backup&) = delete;
   Backup& operator=(const Backup&) = delete;
 
@@ -56,6 +63,12 @@ public:
 private:
   Backup() = default;
 
+  // Restore points are kept in <location>/<backup id>/<restore point id>, so
+  // backups sharing a location do not overwrite each other.
+  fs::Path directory() const;
+  // Directories the garbage collector may visit: those of the restore points,
+  // of removed ones not yet emptied, and of the one being created.
+  std::vector<fs::Path> collectedDirectories();
   Id createRestorePoint(std::span<fs::Path> files, bool incremental);
   void removeRestorePointAt(std::size_t index);
   RestorePoint& getRestorePoint(Id id);
@@ -64,10 +77,12 @@ private:
   Id id;
   time::DateTime creation_time{time::now()};
   fs::Path location;
-  std::size_t size{0};
+  StorageSize size;
   std::unique_ptr<IBackupAlgorithm> algorithm;
   std::unique_ptr<IRestorePointLimit> rp_limit{std::make_unique<RPLBySize>()};
+  std::unique_ptr<GarbageCollector> gc;
   std::deque<RestorePoint> restore_points;
+  std::set<Id> removed_rp_ids;
   Id free_rp_id{0};
 };
 
@@ -0,0 +1,491 @@
+#include "BackupAlgorithm.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+#include "Delta.hpp"
+#include "Journal.hpp"
+#include "Manifest.hpp"
+
+
+namespace backups {
+
+namespace {
+
+constexpr std::uint64_t kChunkSize = 64 * 1024;
+constexpr std::uint64_t kSyncBatchBytes = 256 * 1024 * 1024;
+constexpr std::size_t kSyncBatchFiles = 1024;
+constexpr std::uint64_t kDeltaMinSize = 4 * 1024 * 1024;
+constexpr std::uint64_t kReadAheadSize = 1024 * 1024;
+constexpr std::size_t kOpenStoreLimit = 16;
+
+// Appends to the restore point's stores, keeping only the store being written
+// open; stores and other files written since the last sync are reopened and
+// synced together, followed by the directory if files were created in it.
+class StoreWriter {
+public:
+  // Stores are first cut back to their length in `valid_ends` (or emptied), so
+  // data written by an interrupted attempt is discarded.
+  StoreWriter(
+    const fs::Path& location,
+    const Manifest& manifest,
+    std::map<std::size_t, std::uint64_t> valid_ends
+  ) : location(location), manifest(manifest), valid_ends(std::move(valid_ends)) {}
+
+  std::uint64_t write(std::size_t store, std::span<const char> data) {
+    if (!current || current->first != store) {
+      current.reset();
+      fs::Path path = location / manifest.stores[store];
+      auto end = ends.find(store);
+      if (end == ends.end() && !std::filesystem::exists(path)) {
+        directory_changed = true;
+      }
+      auto file = fs::File::openWrite(path);
+      if (end == ends.end()) {
+        auto valid_end = valid_ends.find(store);
+        end = ends.emplace(store, valid_end == valid_ends.end() ? 0 : valid_end->second).first;
+        file.resize(end->second);
+      }
+      current.emplace(store, std::move(file));
+    }
+    std::uint64_t& end = ends[store];
+    std::uint64_t offset = end;
+    current->second.write(offset, data);
+    end += data.size();
+    unsynced_bytes += data.size();
+    unsynced.insert(store);
+    return offset;
+  }
+
+  // Syncs a file created in the restore point's directory with the next batch.
+  void addFile(const fs::Path& path) {
+    unsynced_files.push_back(path);
+    directory_changed = true;
+  }
+
+  std::uint64_t unsyncedBytes() const {
+    return unsynced_bytes;
+  }
+
+  void sync() {
+    for (std::size_t store: unsynced) {
+      if (current && current->first == store) {
+        current->second.sync();
+      } else {
+        fs::File::openWrite(location / manifest.stores[store]).sync();
+      }
+    }
+    for (const auto& path: unsynced_files) {
+      fs::File::openWrite(path).sync();
+    }
+    if (directory_changed) {
+      fs::syncDirectory(location);
+    }
+    unsynced.clear();
+    unsynced_files.clear();
+    directory_changed = false;
+    unsynced_bytes = 0;
+  }
+
+private:
+  fs::Path location;
+  const Manifest& manifest;
+  std::map<std::size_t, std::uint64_t> valid_ends;
+  std::map<std::size_t, std::uint64_t> ends;
+  std::optional<std::pair<std::size_t, fs::File>> current;
+  std::set<std::size_t> unsynced;
+  std::vector<fs::Path> unsynced_files;
+  bool directory_changed{false};
+  std::uint64_t unsynced_bytes{0};
+};
+
+std::map<std::size_t, std::uint64_t> storeEnds(const Journal& journal) {
+  std::map<std::size_t, std::uint64_t> ends;
+  auto add = [&](const ManifestEntry& entry) {
+    for (const auto& segment: entry.segments) {
+      if (segment.source != SegmentSource::Store) continue;
+      auto& end = ends[segment.store];
+      end = std::max(end, segment.source_offset + segment.length);
+    }
+  };
+  for (const auto& entry: journal.recovered().entries) {
+    add(entry);
+  }
+  if (journal.recoveredPartial()) {
+    add(journal.recoveredPartial()->entry);
+  }
+  return ends;
+}
+
+// Reads from stores through a small set of open files, closing the least
+// recently used one when the set is full.
+class StoreReader {
+public:
+  void read(const fs::Path& store, std::uint64_t offset, std::span<char> buffer) {
+    auto it = std::find_if(files.begin(), files.end(), [&](const auto& file) { return file.first == store; });
+    if (it == files.end()) {
+      if (files.size() == kOpenStoreLimit) files.pop_back();
+      files.emplace_front(store, fs::File::openRead(store));
+    } else if (it != files.begin()) {
+      files.splice(files.begin(), files, it);
+    }
+    files.front().second.read(offset, buffer);
+  }
+
+private:
+  std::list<std::pair<fs::Path, fs::File>> files;
+};
+
+// Reads a version of a file described by resolved segments; holes read as zeros.
+class VersionReader {
+public:
+  VersionReader(std::vector<ResolvedSegment> segments, StoreReader& reader)
+    : segments(std::move(segments)), reader(reader) {}
+
+  const std::vector<ResolvedSegment>& getSegments() const {
+    return segments;
+  }
+
+  void read(std::uint64_t offset, std::span<char> buffer) {
+    std::fill(buffer.begin(), buffer.end(), 0);
+    std::uint64_t end = offset + buffer.size();
+    auto it = std::upper_bound(
+      segments.begin(),
+      segments.end(),
+      offset,
+      [](std::uint64_t value, const ResolvedSegment& segment) { return value < segment.offset; }
+    );
+    if (it != segments.begin()) --it;
+    for (; it != segments.end() && it->offset < end; ++it) {
+      std::uint64_t from = std::max(offset, it->offset);
+      std::uint64_t to = std::min(end, it->offset + it->length);
+      if (from >= to) continue;
+      reader.read(it->store, it->source_offset + (from - it->offset), buffer.subspan(from - offset, to - from));
+    }
+  }
+
+private:
+  std::vector<ResolvedSegment> segments;
+  StoreReader& reader;
+};
+
+void storeData(
+  ManifestEntry& entry,
+  std::size_t store,
+  StoreWriter& writer,
+  std::uint64_t offset,
+  std::span<const char> data
+) {
+  for (std::uint64_t done = 0; done < data.size(); done += kChunkSize) {
+    auto chunk = data.subspan(done, std::min<std::uint64_t>(kChunkSize, data.size() - done));
+    if (fs::isZero(chunk)) continue;
+    entry.addSegment(Segment{offset + done, chunk.size(), SegmentSource::Store, store, writer.write(store, chunk)});
+  }
+}
+
+delta::BlockIndex indexBlocks(VersionReader& version) {
+  // Only blocks that hold data are signed, and the index is sized for those.
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+  std::uint64_t capacity = 0;
+  std::uint64_t next_block = 0;
+  for (const auto& segment: version.getSegments()) {
+    std::uint64_t first = std::max(next_block, segment.offset / delta::kBlockSize);
+    std::uint64_t last = (segment.offset + segment.length) / delta::kBlockSize;
+    if (first >= last) continue;
+    ranges.emplace_back(first, last);
+    capacity += last - first;
+    next_block = last;
+  }
+  delta::BlockIndex index{capacity};
+  std::vector<char> block(delta::kBlockSize);
+  for (const auto& [first, last]: ranges) {
+    for (std::uint64_t i = first; i < last; ++i) {
+      version.read(i * delta::kBlockSize, block);
+      if (fs::isZero(block)) continue;
+      index.add(i, block);
+    }
+  }
+  return index;
+}
+
+// Matches every block-sized window of the file's data extents from `start` on
+// against the previous version; matched blocks become parent references, the
+// rest is stored as literals. `checkpoint` is called with offsets below which
+// everything has been added to `entry`.
+void storeDelta(
+  const fs::File& source,
+  std::uint64_t start,
+  const delta::BlockIndex& index,
+  ManifestEntry& entry,
+  std::size_t store,
+  StoreWriter& writer,
+  const std::function<void(std::uint64_t)>& checkpoint,
+  delta::SignatureWriter* signatures
+) {
+  constexpr std::uint64_t block_size = delta::kBlockSize;
+  for (const auto& extent: source.dataExtents()) {
+    std::uint64_t end = extent.offset + extent.length;
+    if (end <= start) continue;
+    std::uint64_t begin = std::max(extent.offset, start);
+    std::uint64_t base = begin;
+    std::vector<char> data;
+    auto ensure = [&](std::uint64_t upto) {
+      std::uint64_t have = base + data.size();
+      if (have >= upto) return;
+      std::uint64_t target = std::min(end, std::max(upto, have + kReadAheadSize));
+      data.resize(target - base);
+      std::span<char> read{data.data() + (have - base), target - have};
+      source.read(have, read);
+      if (signatures) signatures->add(have, read);
+    };
+    auto discard = [&](std::uint64_t offset) {
+      if (offset - base < kReadAheadSize) return;
+      data.erase(data.begin(), data.begin() + (offset - base));
+      base = offset;
+    };
+    auto storeLiteral = [&](std::uint64_t from, std::uint64_t to) {
+      storeData(entry, store, writer, from, std::span<const char>{data.data() + (from - base), to - from});
+    };
+    std::uint64_t literal_start = begin;
+    std::uint64_t position = begin;
+    delta::RollingChecksum checksum;
+    bool rolling = false;
+    while (position + block_size <= end) {
+      ensure(position + block_size);
+      std::span<const char> window{data.data() + (position - base), block_size};
+      if (!rolling) {
+        checksum.reset(window);
+        rolling = true;
+      }
+      if (auto block = index.find(checksum.value(), window)) {
+        storeLiteral(literal_start, position);
+        entry.addSegment(Segment{position, block_size, SegmentSource::Parent, 0, *block * block_size});
+        position += block_size;
+        literal_start = position;
+        rolling = false;
+        discard(literal_start);
+        checkpoint(literal_start);
+        continue;
+      }
+      if (position + block_size < end) {
+        ensure(position + block_size + 1);
+        checksum.roll(data[position - base], data[position + block_size - base]);
+      }
+      ++position;
+      if (position - literal_start >= kReadAheadSize) {
+        storeLiteral(literal_start, position);
+        literal_start = position;
+        discard(literal_start);
+        checkpoint(literal_start);
+      }
+    }
+    ensure(end);
+    storeLiteral(literal_start, end);
+    checkpoint(end);
+  }
+}
+
+}
+
+StorageSize BAStorageBase::backupFiles(
+  std::span<fs::Path> files,
+  const fs::Path& location,
+  bool incremental,
+  std::optional<fs::Path> parent_rp
+) {
+  fs::createDirectories(location);
+  Manifest manifest;
+  std::optional<Manifest> parent;
+  if (incremental && parent_rp) {
+    manifest.parent = *parent_rp;
+    parent = Manifest::load(*parent_rp);
+  }
+  Journal journal{location};
+  if (!journal.matches(manifest.parent)) {
+    journal.reset(manifest.parent);
+  }
+  const Manifest& recovered = journal.recovered();
+  manifest.stores = recovered.stores;
+  StoreWriter writer{location, manifest, storeEnds(journal)};
+  StoreReader reader;
+  std::optional<ManifestChain> parent_chain;
+  std::vector<char> buffer(kChunkSize);
+  for (std::size_t i = 0; i < files.size(); ++i) {
+    auto source = fs::File::openRead(files[i]);
+    ManifestEntry entry{files[i], source.size(), source.modificationTime(), {}};
+    const ManifestEntry* done = recovered.find(files[i]);
+    if (
+      done
+      && done->logical_size == entry.logical_size
+      && done->modification_time == entry.modification_time
+    ) {
+      manifest.addEntry(*done);
+      continue;
+    }
+    const ManifestEntry* previous = parent ? parent->find(files[i]) : nullptr;
+    if (
+      previous
+      && previous->logical_size == entry.logical_size
+      && previous->modification_time == entry.modification_time
+    ) {
+      if (entry.logical_size > 0) {
+        entry.addSegment(Segment{0, entry.logical_size, SegmentSource::Parent, 0, 0});
+      }
+      if (entry.logical_size >= kDeltaMinSize) {
+        delta::linkSignatures(*parent_rp, location, files[i]);
+      }
+      journal.recordEntry(entry);
+      manifest.addEntry(std::move(entry));
+      continue;
+    }
+    std::uint64_t resume_offset = 0;
+    const auto& partial = journal.recoveredPartial();
+    if (
+      partial
+      && partial->entry.file == entry.file
+      && partial->entry.logical_size == entry.logical_size
+      && partial->entry.modification_time == entry.modification_time
+    ) {
+      entry.segments = partial->entry.segments;
+      resume_offset = partial->resume_offset;
+    }
+    std::size_t store_count = manifest.stores.size();
+    std::size_t store = manifest.addStore(storeName(i));
+    if (manifest.stores.size() != store_count) {
+      journal.recordStore(manifest.stores[store]);
+    }
+    // Large files are synced and journaled part way, so a crash resumes them
+    // from the last commit instead of from the start.
+    std::uint64_t recorded = resume_offset;
+    auto checkpoint = [&](std::uint64_t stored) {
+      if (writer.unsyncedBytes() < kSyncBatchBytes) return;
+      writer.sync();
+      journal.recordPartial(entry, recorded, stored);
+      journal.commit();
+      recorded = stored;
+    };
+    std::optional<delta::BlockIndex> index;
+    if (previous && entry.logical_size >= kDeltaMinSize) {
+      index = delta::loadSignatures(*parent_rp, files[i], previous->logical_size, previous->modification_time);
+      if (!index) {
+        if (!parent_chain) parent_chain.emplace(*parent_rp);
+        VersionReader version{parent_chain->resolve(files[i], 0, previous->logical_size), reader};
+        index = indexBlocks(version);
+      }
+    }
+    // A file resumed part way is left unsigned; the next point reads it back instead.
+    std::optional<delta::SignatureWriter> signatures;
+    if (entry.logical_size >= kDeltaMinSize && resume_offset == 0) {
+      signatures.emplace(location, files[i], entry.logical_size, entry.modification_time);
+    }
+    delta::SignatureWriter* signer = signatures ? &*signatures : nullptr;
+    if (index && !index->empty()) {
+      storeDelta(source, resume_offset, *index, entry, store, writer, checkpoint, signer);
+    } else {
+      for (const auto& extent: source.dataExtents()) {
+        std::uint64_t extent_end = extent.offset + extent.length;
+        for (
+          std::uint64_t offset = std::max(extent.offset, resume_offset);
+          offset < extent_end;
+          offset += kChunkSize
+        ) {
+          std::span<char> chunk{buffer.data(), std::min(kChunkSize, extent_end - offset)};
+          source.read(offset, chunk);
+          if (signer) signer->add(offset, chunk);
+          storeData(entry, store, writer, offset, chunk);
+          checkpoint(offset + chunk.size());
+        }
+      }
+    }
+    if (signer) {
+      signer->finish();
+      writer.addFile(delta::signaturePath(location, files[i]));
+    }
+    journal.recordEntry(entry);
+    manifest.addEntry(std::move(entry));
+    if (writer.unsyncedBytes() >= kSyncBatchBytes || journal.pendingEntries() >= kSyncBatchFiles) {
+      writer.sync();
+      journal.commit();
+    }
+  }
+  writer.sync();
+  manifest.save(location);
+  journal.remove();
+  return manifest.size();
+}
+
+void BAStorageBase::restoreFiles(const fs::Path& backup_location, const fs::Path& destination) {
+  ManifestChain chain{backup_location};
+  StoreReader reader;
+  std::vector<char> buffer(kChunkSize);
+  for (const auto& entry: chain.root().entries) {
+    fs::Path target = destination / entry.file.relative_path();
+    std::filesystem::create_directories(target.parent_path());
+    auto file = fs::File::openWrite(target);
+    file.resize(0);
+    for (const auto& segment: chain.resolve(entry.file, 0, entry.logical_size)) {
+      for (std::uint64_t done = 0; done < segment.length; done += kChunkSize) {
+        std::span<char> chunk{buffer.data(), std::min(kChunkSize, segment.length - done)};
+        reader.read(segment.store, segment.source_offset + done, chunk);
+        file.write(segment.offset + done, chunk);
+      }
+    }
+    file.resize(entry.logical_size);
+  }
+}
+
+StorageSize BAStorageBase::mergeRestorePoints(const fs::Path& source, const fs::Path& destination) {
+  auto parent = Manifest::load(source);
+  auto child = Manifest::load(destination);
+  for (auto& entry: child.entries) {
+    ManifestEntry merged{entry.file, entry.logical_size, entry.modification_time, {}};
+    for (const auto& segment: entry.segments) {
+      if (segment.source == SegmentSource::Store) {
+        merged.addSegment(segment);
+        continue;
+      }
+      const ManifestEntry* base = parent.find(entry.file);
+      if (!base) {
+        throw std::runtime_error("Could not find " + entry.file.string() + " in " + source.string());
+      }
+      for (const auto& piece: base->slice(segment.source_offset, segment.length)) {
+        std::uint64_t offset = segment.offset + (piece.offset - segment.source_offset);
+        if (piece.source == SegmentSource::Parent) {
+          merged.addSegment(Segment{offset, piece.length, SegmentSource::Parent, 0, piece.source_offset});
+          continue;
+        }
+        fs::Path store_path = (source / parent.stores[piece.store]).lexically_normal();
+        std::size_t store = child.addStore(store_path.lexically_relative(destination.lexically_normal()));
+        merged.addSegment(Segment{offset, piece.length, SegmentSource::Store, store, piece.source_offset});
+      }
+    }
+    entry.segments = std::move(merged.segments);
+  }
+  child.parent = parent.parent;
+  child.save(destination);
+  return child.size();
+}
+
+void BAStorageBase::removeRestorePoint(const fs::Path& location) {
+  Manifest::remove(location);
+}
+
+std::unique_ptr<IBackupAlgorithm> makeBackupAlgorithm(const std::string& name) {
+  std::unique_ptr<IBackupAlgorithm> algorithm;
+  if (name == BASeparateStorage{}.getName()) {
+    algorithm = std::make_unique<BASeparateStorage>();
+  } else if (name == BACombinedStorage{}.getName()) {
+    algorithm = std::make_unique<BACombinedStorage>();
+  } else {
+    throw std::runtime_error("Unknown backup algorithm " + name);
+  }
+  return algorithm;
+}
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <span>
 #include <string>
@@ -16,42 +17,53 @@ public:
 
   virtual std::string getName() const = 0;
 
-  virtual std::size_t backupFiles(
+  virtual StorageSize backupFiles(
     std::span<fs::Path> files,
     const fs::Path& location,
     bool incremental,
     std::optional<fs::Path> parent_rp = std::nullopt
   ) = 0;
   virtual void restoreFiles(const fs::Path& backup_location, const fs::Path& destination) = 0;
-  virtual std::size_t mergeRestorePoints(const fs::Path& source, const fs::Path& destination) = 0;
+  virtual StorageSize mergeRestorePoints(const fs::Path& source, const fs::Path& destination) = 0;
+  virtual void removeRestorePoint(const fs::Path& location) = 0;
 };
 
-class BASeparateStorage: public IBackupAlgorithm {
+// Stores only the data extents of each file, skipping holes and zero-filled chunks,
+// and recreates them as holes on restore. Merging and removing restore points only
+// rewrite manifests; stores are reclaimed by GarbageCollector.
+class BAStorageBase: public IBackupAlgorithm {
 public:
-  std::string getName() const override { return "Separate Storage"; };
-
-  std::size_t backupFiles(
+  StorageSize backupFiles(
     std::span<fs::Path> files,
     const fs::Path& location,
     bool incremental,
     std::optional<fs::Path> parent_rp = std::nullopt
-  ) override { return rand() % 1000; }
-  void restoreFiles(const fs::Path& backup_location, const fs::Path& destination) override {}
-  std::size_t mergeRestorePoints(const fs::Path& source, const fs::Path& destination) override { return rand() % 1000; }
+  ) override;
+  void restoreFiles(const fs::Path& backup_location, const fs::Path& destination) override;
+  StorageSize mergeRestorePoints(const fs::Path& source, const fs::Path& destination) override;
+  void removeRestorePoint(const fs::Path& location) override;
+
+protected:
+  virtual fs::Path storeName(std::size_t entry_index) const = 0;
 };
 
-class BACombinedStorage: public IBackupAlgorithm {
+class BASeparateStorage: public BAStorageBase {
+public:
+  std::string getName() const override { return "Separate Storage"; };
+
+protected:
+  fs::Path storeName(std::size_t entry_index) const override { return std::to_string(entry_index) + ".data"; }
+};
+
+class BACombinedStorage: public BAStorageBase {
 public:
   std::string getName() const override { return "Combined Storage"; };
 
-  std::size_t backupFiles(
-    std::span<fs::Path> files,
-    const fs::Path& location,
-    bool incremental,
-    std::optional<fs::Path> parent_rp = std::nullopt
-  ) override { return rand() % 1000; }
-  void restoreFiles(const fs::Path& backup_location, const fs::Path& destination) override {}
-  std::size_t mergeRestorePoints(const fs::Path& source, const fs::Path& destination) override { return rand() % 1000; }
+protected:
+  fs::Path storeName(std::size_t entry_index) const override { return "combined.data"; }
 };
 
+// Creates the algorithm whose getName() is `name`.
+std::unique_ptr<IBackupAlgorithm> makeBackupAlgorithm(const std::string& name);
+
 }
@@ -1,14 +1,39 @@
 #include "BackupManager.hpp"
 
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
 
 namespace backups {
 
+BackupManager::BackupManager(fs::Path catalog): catalog(std::move(catalog)) {}
+
 void BackupManager::loadBackupData() {
-  //! placeholder
+  backups.clear();
+  free_backup_id = 0;
+  if (!std::filesystem::exists(catalog)) return;
+  std::ifstream stream(catalog);
+  std::string keyword;
+  std::size_t count = 0;
+  if (!(stream >> keyword >> free_backup_id >> count) || keyword != "backups") {
+    throw std::runtime_error("Malformed backup catalog " + catalog.string());
+  }
+  for (std::size_t i = 0; i < count; ++i) {
+    backups.push_back(Backup::load(stream));
+  }
 }
 
+// Written after every command, once the restore points it created are durable,
+// so a restart picks up the same ids and an interrupted point resumes from its journal.
 void BackupManager::saveBackupData() {
-  //! placeholder
+  std::ostringstream stream;
+  stream << "backups " << free_backup_id << ' ' << backups.size() << '\n';
+  for (const auto& backup: backups) {
+    backup.save(stream);
+  }
+  fs::replaceFile(catalog, stream.str());
 }
 
 std::vector<std::string> BackupManager::printableList() const {
@@ -55,4 +80,18 @@ bool BackupManager::removeBackup(std::uint64_t id) {
   return false;
 }
 
+// A backup whose collection fails does not hold up the others; the first
+// failure is rethrown once every backup has had its step.
+void BackupManager::collectGarbage(std::uint64_t io_budget) {
+  std::exception_ptr error;
+  for (auto& backup: backups) {
+    try {
+      backup.collectGarbage(io_budget);
+    } catch (...) {
+      if (!error) error = std::current_exception();
+    }
+  }
+  if (error) std::rethrow_exception(error);
+}
+
 }
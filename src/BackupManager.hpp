@@ -13,7 +13,7 @@ namespace backups {
 
 class BackupManager {
 public:
-  BackupManager() = default;
+  explicit BackupManager(fs::Path catalog);
 
   void loadBackupData();
   void saveBackupData();
@@ -29,6 +29,8 @@ public:
   Backup& getBackup(Id id);
   bool removeBackup(Id id);
 
+  void collectGarbage(std::uint64_t io_budget);
+
   BackupManager(const BackupManager&) = delete;
   BackupManager& operator=(const BackupManager&) = delete;
 
@@ -36,6 +38,7 @@ public:
   BackupManager& operator=(BackupManager&&) = delete;
 
 private:
+  fs::Path catalog;
   Id free_backup_id{0};
   std::vector<Backup> backups;
 };
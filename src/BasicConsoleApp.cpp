@@ -7,7 +7,8 @@
 #include "BackupManager.hpp"
 
 
-static backups::BackupManager backup_manager;
+static backups::BackupManager backup_manager{"backups.catalog"};
+static constexpr std::uint64_t kGarbageCollectionBudget = 64 * 1024 * 1024;
 
 bool parseCommand(std::span<std::string> arguments) {
   std::string command = arguments[0];
@@ -81,6 +82,9 @@ bool parseCommand(std::span<std::string> arguments) {
     backups::Id rp_id = std::stoi(arguments[2]);
     backups::fs::Path location = arguments[3];
     backup_manager.getBackup(id).restoreFiles(rp_id, location);
+  } else if (command == "gc") {
+    backups::Id id = std::stoi(arguments[1]);
+    while (!backup_manager.getBackup(id).collectGarbage(kGarbageCollectionBudget)) {}
   } else if (command == "exit") {
     return false;
   }
@@ -92,19 +96,46 @@ void run() {
   std::string argument;
   while (true) {
     std::cout << "> ";
-    std::getline(std::cin, command);
+    if (!std::getline(std::cin, command)) {
+      break;
+    }
     std::stringstream stream(command);
     std::vector<std::string> arguments;
     while (std::getline(stream, argument, ' ')) {
       arguments.push_back(argument);
     }
-    if (!parseCommand(arguments)) {
+    if (arguments.empty()) {
+      continue;
+    }
+    bool running = true;
+    try {
+      running = parseCommand(arguments);
+    } catch (const std::exception& e) {
+      std::cerr << "error: " << e.what() << std::endl;
+    }
+    try {
+      backup_manager.saveBackupData();
+    } catch (const std::exception& e) {
+      std::cerr << "error: " << e.what() << std::endl;
+    }
+    if (!running) {
       break;
     }
+    try {
+      backup_manager.collectGarbage(kGarbageCollectionBudget);
+    } catch (const std::exception& e) {
+      std::cerr << "garbage collection error: " << e.what() << std::endl;
+    }
   }
 }
 
 int main() {
+  try {
+    backup_manager.loadBackupData();
+  } catch (const std::exception& e) {
+    std::cerr << "error: " << e.what() << std::endl;
+    return 1;
+  }
   run();
   return 0;
 }
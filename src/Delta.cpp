@@ -0,0 +1,298 @@
+#include "Delta.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+
+namespace backups::delta {
+
+namespace {
+
+// BLAKE2b (RFC 7693), unkeyed, with a 16 byte digest.
+constexpr std::uint64_t kBlake2bInit[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+  0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+constexpr std::uint8_t kBlake2bSigma[12][16] = {
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+  {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+  {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+  {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+  {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+  {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+  {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+  {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+  {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+  {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}
+};
+
+constexpr std::size_t kBlake2bBlockSize = 128;
+
+std::uint64_t loadLittleEndian(const unsigned char* bytes) {
+  std::uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+void blake2bCompress(std::uint64_t (&h)[8], const unsigned char* block, std::uint64_t counter, bool last) {
+  std::uint64_t m[16];
+  for (int i = 0; i < 16; ++i) {
+    m[i] = loadLittleEndian(block + 8 * i);
+  }
+  std::uint64_t v[16];
+  for (int i = 0; i < 8; ++i) {
+    v[i] = h[i];
+    v[i + 8] = kBlake2bInit[i];
+  }
+  v[12] ^= counter;
+  if (last) v[14] = ~v[14];
+  auto g = [&v](int a, int b, int c, int d, std::uint64_t x, std::uint64_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = std::rotr(v[d] ^ v[a], 32);
+    v[c] = v[c] + v[d];
+    v[b] = std::rotr(v[b] ^ v[c], 24);
+    v[a] = v[a] + v[b] + y;
+    v[d] = std::rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = std::rotr(v[b] ^ v[c], 63);
+  };
+  for (const auto& s: kBlake2bSigma) {
+    g(0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g(1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g(2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g(3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g(0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g(2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g(3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+  for (int i = 0; i < 8; ++i) {
+    h[i] ^= v[i] ^ v[i + 8];
+  }
+}
+
+constexpr std::uint64_t kSignatureBufferSize = 1024 * 1024;
+
+static_assert(sizeof(BlockSignature) == 32);
+
+std::string signatureHeader(const fs::Path& file, std::uint64_t logical_size, std::int64_t modification_time) {
+  std::ostringstream stream;
+  stream << "signatures blake2b-128 " << std::quoted(file.string()) << ' ' << logical_size << ' ' << modification_time << '\n';
+  return stream.str();
+}
+
+// Signature files of unchanged files are hard links to the parent's, so they
+// are replaced rather than rewritten in place.
+fs::File createSignatureFile(const fs::Path& path) {
+  std::filesystem::remove(path);
+  return fs::File::openWrite(path);
+}
+
+}
+
+void RollingChecksum::reset(std::span<const char> window) {
+  a = 0;
+  b = 0;
+  length = window.size();
+  for (std::size_t i = 0; i < window.size(); ++i) {
+    std::uint32_t byte = static_cast<unsigned char>(window[i]);
+    a += byte;
+    b += (length - i) * byte;
+  }
+}
+
+StrongHash strongHash(std::span<const char> data) {
+  std::uint64_t h[8];
+  std::copy(std::begin(kBlake2bInit), std::end(kBlake2bInit), h);
+  h[0] ^= 0x01010000 ^ sizeof(StrongHash);
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+  std::size_t offset = 0;
+  for (; data.size() - offset > kBlake2bBlockSize; offset += kBlake2bBlockSize) {
+    blake2bCompress(h, bytes + offset, offset + kBlake2bBlockSize, false);
+  }
+  unsigned char last[kBlake2bBlockSize] = {};
+  if (!data.empty()) std::memcpy(last, bytes + offset, data.size() - offset);
+  blake2bCompress(h, last, data.size(), true);
+  return StrongHash{h[0], h[1]};
+}
+
+BlockIndex::BlockIndex(std::uint64_t capacity)
+  : filter_bits(std::clamp<unsigned>(std::bit_width(capacity * 16), 16, 20)),
+    filter((std::uint64_t{1} << filter_bits) / 64),
+    slots(std::bit_ceil(std::max<std::uint64_t>(16, capacity * 2)), Slot{0, 0}) {}
+
+std::size_t BlockIndex::slotOf(std::uint32_t weak) const {
+  return ((weak * 0x9e3779b97f4a7c15ULL) >> 32) & (slots.size() - 1);
+}
+
+std::uint64_t BlockIndex::filterBit(std::uint32_t weak) const {
+  return (weak * 0xc2b2ae3d27d4eb4fULL) >> (64 - filter_bits);
+}
+
+void BlockIndex::add(std::uint64_t block, std::span<const char> data) {
+  RollingChecksum checksum;
+  checksum.reset(data);
+  add(block, checksum.value(), strongHash(data));
+}
+
+void BlockIndex::add(std::uint64_t block, std::uint32_t weak, const StrongHash& strong) {
+  if ((signatures.size() + 1) * 2 > slots.size()) {
+    throw std::runtime_error("Block index is full");
+  }
+  std::uint64_t bit = filterBit(weak);
+  filter[bit / 64] |= std::uint64_t{1} << (bit % 64);
+  std::size_t slot = slotOf(weak);
+  while (slots[slot].head != 0 && slots[slot].weak != weak) {
+    slot = (slot + 1) & (slots.size() - 1);
+  }
+  signatures.push_back(Signature{strong, block, slots[slot].head});
+  slots[slot] = Slot{weak, static_cast<std::uint32_t>(signatures.size())};
+}
+
+bool BlockIndex::empty() const {
+  return signatures.empty();
+}
+
+std::optional<std::uint64_t> BlockIndex::find(std::uint32_t weak, std::span<const char> window) const {
+  std::uint64_t bit = filterBit(weak);
+  if ((filter[bit / 64] >> (bit % 64) & 1) == 0) return std::nullopt;
+  std::size_t slot = slotOf(weak);
+  while (slots[slot].head != 0 && slots[slot].weak != weak) {
+    slot = (slot + 1) & (slots.size() - 1);
+  }
+  if (slots[slot].head == 0) return std::nullopt;
+  StrongHash strong = strongHash(window);
+  for (std::uint32_t i = slots[slot].head; i != 0; i = signatures[i - 1].next) {
+    if (signatures[i - 1].strong == strong) return signatures[i - 1].block;
+  }
+  return std::nullopt;
+}
+
+fs::Path signaturePath(const fs::Path& location, const fs::Path& file) {
+  std::string name = file.string();
+  std::ostringstream stream;
+  stream << std::hex << std::setw(16) << std::setfill('0') << strongHash(name).low << ".sig";
+  return location / stream.str();
+}
+
+SignatureWriter::SignatureWriter(
+  const fs::Path& location,
+  const fs::Path& file,
+  std::uint64_t logical_size,
+  std::int64_t modification_time
+) : output(createSignatureFile(signaturePath(location, file))),
+    logical_size(logical_size),
+    buffer(signatureHeader(file, logical_size, modification_time)),
+    block(kBlockSize) {}
+
+void SignatureWriter::add(std::uint64_t offset, std::span<const char> data) {
+  std::uint64_t position = next_block * kBlockSize + filled;
+  if (offset > position && filled > 0) {
+    std::uint64_t gap = std::min(offset - position, kBlockSize - filled);
+    std::fill_n(block.begin() + filled, gap, 0);
+    filled += gap;
+    if (filled == kBlockSize) sign();
+  }
+  if (offset > next_block * kBlockSize + filled) {
+    next_block = offset / kBlockSize;
+    filled = offset % kBlockSize;
+    std::fill_n(block.begin(), filled, 0);
+  }
+  while (!data.empty()) {
+    std::uint64_t length = std::min<std::uint64_t>(kBlockSize - filled, data.size());
+    std::copy_n(data.begin(), length, block.begin() + filled);
+    filled += length;
+    data = data.subspan(length);
+    if (filled == kBlockSize) sign();
+  }
+}
+
+void SignatureWriter::finish() {
+  if (filled > 0 && (next_block + 1) * kBlockSize <= logical_size) {
+    std::fill(block.begin() + filled, block.end(), 0);
+    sign();
+  }
+  buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+  flush();
+}
+
+void SignatureWriter::sign() {
+  if (!fs::isZero(block)) {
+    RollingChecksum checksum;
+    checksum.reset(block);
+    BlockSignature signature{next_block, strongHash(block), checksum.value(), 0};
+    buffer.append(reinterpret_cast<const char*>(&signature), sizeof(signature));
+    ++count;
+    if (buffer.size() >= kSignatureBufferSize) flush();
+  }
+  ++next_block;
+  filled = 0;
+}
+
+void SignatureWriter::flush() {
+  output.write(written, buffer);
+  written += buffer.size();
+  buffer.clear();
+}
+
+std::optional<BlockIndex> loadSignatures(
+  const fs::Path& location,
+  const fs::Path& file,
+  std::uint64_t logical_size,
+  std::int64_t modification_time
+) {
+  fs::Path path = signaturePath(location, file);
+  if (!std::filesystem::exists(path)) return std::nullopt;
+  auto input = fs::File::openRead(path);
+  std::uint64_t size = input.size();
+  std::string header = signatureHeader(file, logical_size, modification_time);
+  std::uint64_t count = 0;
+  if (size < header.size() + sizeof(count)) return std::nullopt;
+  std::string stored_header(header.size(), '\0');
+  input.read(0, stored_header);
+  input.read(size - sizeof(count), std::span<char>{reinterpret_cast<char*>(&count), sizeof(count)});
+  std::uint64_t block_count = logical_size / kBlockSize;
+  if (
+    stored_header != header
+    || count > block_count
+    || size != header.size() + count * sizeof(BlockSignature) + sizeof(count)
+  ) {
+    return std::nullopt;
+  }
+  BlockIndex index{count};
+  std::vector<BlockSignature> signatures(kSignatureBufferSize / sizeof(BlockSignature));
+  for (std::uint64_t done = 0; done < count;) {
+    std::uint64_t batch = std::min<std::uint64_t>(signatures.size(), count - done);
+    input.read(
+      header.size() + done * sizeof(BlockSignature),
+      std::span<char>{reinterpret_cast<char*>(signatures.data()), batch * sizeof(BlockSignature)}
+    );
+    for (std::uint64_t i = 0; i < batch; ++i) {
+      if (signatures[i].block >= block_count) return std::nullopt;
+      index.add(signatures[i].block, signatures[i].weak, signatures[i].strong);
+    }
+    done += batch;
+  }
+  return index;
+}
+
+void linkSignatures(const fs::Path& parent_location, const fs::Path& location, const fs::Path& file) {
+  fs::Path source = signaturePath(parent_location, file);
+  if (!std::filesystem::exists(source)) return;
+  fs::Path target = signaturePath(location, file);
+  std::error_code error;
+  std::filesystem::remove(target, error);
+  std::filesystem::create_hard_link(source, target, error);
+}
+
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Filesystem.hpp"
+
+
+namespace backups::delta {
+
+constexpr std::uint64_t kBlockSize = 16 * 1024;
+
+// rsync-style weak checksum that can be rolled one byte at a time.
+class RollingChecksum {
+public:
+  void reset(std::span<const char> window);
+
+  void roll(char removed, char added) {
+    std::uint32_t out = static_cast<unsigned char>(removed);
+    std::uint32_t in = static_cast<unsigned char>(added);
+    a = a - out + in;
+    b = b - length * out + a;
+  }
+
+  std::uint32_t value() const {
+    return (a & 0xffff) | (b << 16);
+  }
+
+private:
+  std::uint32_t a{0};
+  std::uint32_t b{0};
+  std::uint32_t length{0};
+};
+
+struct StrongHash {
+  std::uint64_t low;
+  std::uint64_t high;
+
+  bool operator==(const StrongHash& other) const = default;
+};
+
+// BLAKE2b with a 16 byte digest.
+StrongHash strongHash(std::span<const char> data);
+
+// Signatures of the blocks of a file's previous version. Sized for at most
+// `capacity` signatures, so a sparse version needs only as much memory as it has data.
+class BlockIndex {
+public:
+  explicit BlockIndex(std::uint64_t capacity);
+
+  void add(std::uint64_t block, std::span<const char> data);
+  void add(std::uint64_t block, std::uint32_t weak, const StrongHash& strong);
+  bool empty() const;
+  std::optional<std::uint64_t> find(std::uint32_t weak, std::span<const char> window) const;
+
+private:
+  struct Signature {
+    StrongHash strong;
+    std::uint64_t block;
+    std::uint32_t next;
+  };
+
+  // Open-addressed by weak checksum; `head` is one past the first signature with
+  // that checksum, or zero for a free slot.
+  struct Slot {
+    std::uint32_t weak;
+    std::uint32_t head;
+  };
+
+  std::size_t slotOf(std::uint32_t weak) const;
+  std::uint64_t filterBit(std::uint32_t weak) const;
+
+private:
+  // Most windows match no block; this cache-sized bitset rejects them before
+  // the slot table is probed.
+  unsigned filter_bits;
+  std::vector<std::uint64_t> filter;
+  std::vector<Slot> slots;
+  std::vector<Signature> signatures;
+};
+
+// Signature of a non-zero block, as kept in a signature file.
+struct BlockSignature {
+  std::uint64_t block;
+  StrongHash strong;
+  std::uint32_t weak;
+  std::uint32_t reserved;
+};
+
+// Block signatures of a version of a file are kept next to the manifest of the
+// restore point that stored it, so the next incremental point does not have to
+// read that version back through the restore point chain.
+fs::Path signaturePath(const fs::Path& location, const fs::Path& file);
+
+// Signs the blocks of a version of `file` from its data, which is passed in
+// order of offset; ranges that are skipped read as zeros.
+class SignatureWriter {
+public:
+  SignatureWriter(
+    const fs::Path& location,
+    const fs::Path& file,
+    std::uint64_t logical_size,
+    std::int64_t modification_time
+  );
+
+  void add(std::uint64_t offset, std::span<const char> data);
+  // Signs the last block; a signature file is only loaded once finished. The
+  // caller syncs the file.
+  void finish();
+
+private:
+  void sign();
+  void flush();
+
+private:
+  fs::File output;
+  std::uint64_t logical_size;
+  std::uint64_t written{0};
+  std::uint64_t count{0};
+  std::string buffer;
+  std::vector<char> block;
+  std::uint64_t next_block{0};
+  std::uint64_t filled{0};
+};
+
+// Index of the signatures stored for this version of `file` at `location`, if
+// there are any and they are complete.
+std::optional<BlockIndex> loadSignatures(
+  const fs::Path& location,
+  const fs::Path& file,
+  std::uint64_t logical_size,
+  std::int64_t modification_time
+);
+
+// Makes the signatures of an unchanged file available at `location` as well.
+void linkSignatures(const fs::Path& parent_location, const fs::Path& location, const fs::Path& file);
+
+}
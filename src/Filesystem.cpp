@@ -0,0 +1,179 @@
+#include "Filesystem.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace backups::fs {
+
+namespace {
+
+[[noreturn]] void fail(const char* action, const Path& path) {
+  throw std::runtime_error(
+    std::string("Could not ") + action + " " + path.string() + ": " + std::strerror(errno)
+  );
+}
+
+struct stat statFile(int fd, const Path& path) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0) fail("stat", path);
+  return st;
+}
+
+}
+
+File File::openRead(const Path& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) fail("open", path);
+  return File{fd, path};
+}
+
+File File::openWrite(const Path& path) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) fail("open", path);
+  return File{fd, path};
+}
+
+File::File(int fd, Path path): fd(fd), path(std::move(path)) {}
+
+File::~File() {
+  if (fd >= 0) ::close(fd);
+}
+
+File::File(File&& other) noexcept: fd(std::exchange(other.fd, -1)), path(std::move(other.path)) {}
+
+File& File::operator=(File&& other) noexcept {
+  if (this == &other) return *this;
+  if (fd >= 0) ::close(fd);
+  fd = std::exchange(other.fd, -1);
+  path = std::move(other.path);
+  return *this;
+}
+
+std::uint64_t File::size() const {
+  return statFile(fd, path).st_size;
+}
+
+std::int64_t File::modificationTime() const {
+  auto st = statFile(fd, path);
+  return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+}
+
+std::vector<Extent> File::dataExtents() const {
+  std::uint64_t file_size = size();
+  std::vector<Extent> extents;
+  off_t position = 0;
+  while (static_cast<std::uint64_t>(position) < file_size) {
+    off_t data = ::lseek(fd, position, SEEK_DATA);
+    if (data < 0) {
+      if (errno == ENXIO) break;
+      if (errno == EINVAL || errno == EOPNOTSUPP) {
+        return {Extent{0, file_size}};
+      }
+      fail("seek", path);
+    }
+    off_t hole = ::lseek(fd, data, SEEK_HOLE);
+    if (hole < 0) fail("seek", path);
+    hole = std::min<off_t>(hole, file_size);
+    extents.push_back(Extent{
+      static_cast<std::uint64_t>(data),
+      static_cast<std::uint64_t>(hole - data)
+    });
+    position = hole;
+  }
+  return extents;
+}
+
+void File::read(std::uint64_t offset, std::span<char> buffer) const {
+  while (!buffer.empty()) {
+    ssize_t count = ::pread(fd, buffer.data(), buffer.size(), offset);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      fail("read", path);
+    }
+    if (count == 0) {
+      throw std::runtime_error("Unexpected end of file " + path.string());
+    }
+    buffer = buffer.subspan(count);
+    offset += count;
+  }
+}
+
+void File::write(std::uint64_t offset, std::span<const char> data) {
+  while (!data.empty()) {
+    ssize_t count = ::pwrite(fd, data.data(), data.size(), offset);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      fail("write", path);
+    }
+    data = data.subspan(count);
+    offset += count;
+  }
+}
+
+void File::resize(std::uint64_t size) {
+  if (::ftruncate(fd, size) != 0) fail("resize", path);
+}
+
+void File::sync() {
+  if (::fsync(fd) != 0) fail("sync", path);
+}
+
+bool isZero(std::span<const char> data) {
+  if (data.empty()) return true;
+  return data[0] == 0 && std::memcmp(data.data(), data.data() + 1, data.size() - 1) == 0;
+}
+
+void syncDirectory(const Path& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) fail("open", path);
+  int result = ::fsync(fd);
+  ::close(fd);
+  if (result != 0) fail("sync", path);
+}
+
+void createDirectories(const Path& path) {
+  if (path.empty() || std::filesystem::exists(path)) return;
+  createDirectories(path.parent_path());
+  std::filesystem::create_directory(path);
+  syncDirectory(path.parent_path().empty() ? Path{"."} : path.parent_path());
+}
+
+std::uint64_t diskUsage(const Path& path) {
+  // Hard-linked files (such as shared signature files) are counted once.
+  std::set<std::pair<dev_t, ino_t>> linked;
+  auto allocated = [&](const Path& file) -> std::uint64_t {
+    struct stat st;
+    if (::lstat(file.c_str(), &st) != 0) return 0;
+    if (st.st_nlink > 1 && !linked.emplace(st.st_dev, st.st_ino).second) return 0;
+    return static_cast<std::uint64_t>(st.st_blocks) * 512;
+  };
+  if (!std::filesystem::is_directory(path)) return allocated(path);
+  std::uint64_t usage = 0;
+  for (const auto& entry: std::filesystem::recursive_directory_iterator(path)) {
+    if (entry.is_regular_file()) usage += allocated(entry.path());
+  }
+  return usage;
+}
+
+void replaceFile(const Path& path, std::string_view content) {
+  Path temporary = path;
+  temporary += ".tmp";
+  auto file = File::openWrite(temporary);
+  file.resize(0);
+  file.write(0, content);
+  file.sync();
+  std::filesystem::rename(temporary, path);
+  syncDirectory(path.parent_path().empty() ? Path{"."} : path.parent_path());
+}
+
+}
@@ -1,12 +1,66 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
 
 
 namespace backups::fs {
 
 using Path = std::filesystem::path;
 
-inline void remove(const Path& path) { /* placeholder */ };
+struct Extent {
+  std::uint64_t offset;
+  std::uint64_t length;
+};
+
+class File {
+public:
+  static File openRead(const Path& path);
+  static File openWrite(const Path& path);
+
+  std::uint64_t size() const;
+  std::int64_t modificationTime() const;
+
+  // Data regions of the file; holes are skipped where the filesystem reports them.
+  std::vector<Extent> dataExtents() const;
+
+  void read(std::uint64_t offset, std::span<char> buffer) const;
+  void write(std::uint64_t offset, std::span<const char> data);
+  void resize(std::uint64_t size);
+  void sync();
+
+  ~File();
+
+  File(const File&) = delete;
+  File& operator=(const File&) = delete;
+
+  File(File&& other) noexcept;
+  File& operator=(File&& other) noexcept;
+
+private:
+  File(int fd, Path path);
+
+private:
+  int fd{-1};
+  Path path;
+};
+
+bool isZero(std::span<const char> data);
+
+void syncDirectory(const Path& path);
+
+// Creates the directory and any missing parents, syncing each new directory entry.
+void createDirectories(const Path& path);
+
+// Bytes allocated on disk for the file or the files under the directory; holes are not counted.
+std::uint64_t diskUsage(const Path& path);
+
+// Replaces the file's content so that a crash leaves either the old or the new version.
+void replaceFile(const Path& path, std::string_view content);
+
+inline void remove(const Path& path) { std::filesystem::remove_all(path); };
 
 }
@@ -0,0 +1,228 @@
+#include "GarbageCollector.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "Journal.hpp"
+#include "Manifest.hpp"
+
+
+namespace backups {
+
+namespace {
+
+constexpr std::uint64_t kCopyChunkSize = 1024 * 1024;
+// Budget charged for each directory entry looked at or removed by the sweep.
+constexpr std::uint64_t kEntryCost = 4096;
+
+void charge(std::uint64_t& io_budget, std::uint64_t bytes) {
+  io_budget -= std::min(io_budget, bytes);
+}
+
+}
+
+GarbageCollector::GarbageCollector(double min_live_ratio)
+  : min_live_ratio(min_live_ratio) {}
+
+bool GarbageCollector::step(std::uint64_t io_budget, const std::vector<fs::Path>& directories) {
+  if (phase == Phase::Idle) {
+    stores.clear();
+    pinned.clear();
+    pending = directories;
+    phase = Phase::Mark;
+  }
+  if (phase == Phase::Mark) {
+    for (; !pending.empty(); pending.pop_back()) {
+      if (io_budget == 0) return false;
+      mark(pending.back(), io_budget);
+    }
+    mergeLiveRanges();
+    pending = directories;
+    phase = Phase::Sweep;
+  }
+  if (phase == Phase::Sweep) {
+    for (; !pending.empty(); pending.pop_back()) {
+      if (io_budget == 0) return false;
+      sweep(pending.back(), io_budget);
+    }
+    plan();
+    phase = Phase::Compact;
+  }
+  while (!compactions.empty()) {
+    auto& compaction = compactions.front();
+    if (!compaction.relocating) {
+      if (!compact(compaction, io_budget)) return false;
+      compaction.relocating = directories;
+    }
+    for (; !compaction.relocating->empty(); compaction.relocating->pop_back()) {
+      if (io_budget == 0) return false;
+      relocate(compaction, compaction.relocating->back(), io_budget);
+    }
+    compactions.pop_front();
+  }
+  phase = Phase::Idle;
+  return true;
+}
+
+void GarbageCollector::invalidate() {
+  if (phase == Phase::Mark || phase == Phase::Sweep) {
+    phase = Phase::Idle;
+  }
+}
+
+void GarbageCollector::mark(const fs::Path& directory, std::uint64_t& io_budget) {
+  if (Journal::exists(directory)) pinned.insert(directory);
+  if (!Manifest::exists(directory)) return;
+  charge(io_budget, std::filesystem::file_size(Manifest::path(directory)));
+  auto manifest = Manifest::load(directory);
+  for (const auto& entry: manifest.entries) {
+    for (const auto& segment: entry.segments) {
+      if (segment.source != SegmentSource::Store) continue;
+      fs::Path store = (directory / manifest.stores[segment.store]).lexically_normal();
+      stores[store].live.push_back(fs::Extent{segment.source_offset, segment.length});
+    }
+  }
+}
+
+void GarbageCollector::mergeLiveRanges() {
+  for (auto& [store, usage]: stores) {
+    std::sort(usage.live.begin(), usage.live.end(), [](const fs::Extent& lhs, const fs::Extent& rhs) {
+      return lhs.offset < rhs.offset;
+    });
+    std::vector<fs::Extent> merged;
+    for (const auto& extent: usage.live) {
+      if (!merged.empty() && extent.offset <= merged.back().offset + merged.back().length) {
+        auto& last = merged.back();
+        last.length = std::max(last.length, extent.offset + extent.length - last.offset);
+        continue;
+      }
+      merged.push_back(extent);
+    }
+    usage.live = std::move(merged);
+    usage.live_bytes = 0;
+    for (const auto& extent: usage.live) {
+      usage.live_bytes += extent.length;
+    }
+  }
+}
+
+void GarbageCollector::sweep(const fs::Path& directory, std::uint64_t& io_budget) {
+  if (pinned.count(directory) || !std::filesystem::exists(directory)) return;
+  bool has_manifest = Manifest::exists(directory);
+  std::vector<fs::Path> garbage;
+  std::size_t kept = 0;
+  for (const auto& file: std::filesystem::directory_iterator(directory)) {
+    fs::Path path = file.path().lexically_normal();
+    bool signatures = has_manifest && path.extension() == ".sig";
+    if (path == Manifest::path(directory) || stores.count(path) || signatures) {
+      ++kept;
+      continue;
+    }
+    garbage.push_back(path);
+  }
+  charge(io_budget, (kept + garbage.size()) * kEntryCost);
+  for (const auto& path: garbage) {
+    std::filesystem::remove_all(path);
+  }
+  if (!has_manifest && kept == 0) {
+    std::filesystem::remove(directory);
+  }
+}
+
+// Builds the whole plan before queueing it, so a failure leaves nothing queued
+// and the next step plans again. Targets are only created once copied to.
+void GarbageCollector::plan() {
+  std::deque<Compaction> planned;
+  std::set<fs::Path> targets;
+  for (const auto& [store, usage]: stores) {
+    if (pinned.count(store.parent_path()) || !std::filesystem::exists(store)) continue;
+    std::uint64_t size = std::filesystem::file_size(store);
+    if (usage.live_bytes >= min_live_ratio * size) continue;
+    Compaction compaction;
+    compaction.store = store;
+    for (std::size_t i = 0;; ++i) {
+      compaction.target = store.parent_path() / ("compacted." + std::to_string(i) + ".data");
+      if (!targets.count(compaction.target) && !std::filesystem::exists(compaction.target)) break;
+    }
+    targets.insert(compaction.target);
+    compaction.live = usage.live;
+    std::uint64_t offset = 0;
+    for (const auto& extent: compaction.live) {
+      compaction.targets.push_back(offset);
+      offset += extent.length;
+    }
+    planned.push_back(std::move(compaction));
+  }
+  compactions.swap(planned);
+}
+
+bool GarbageCollector::compact(Compaction& compaction, std::uint64_t& io_budget) {
+  auto input = fs::File::openRead(compaction.store);
+  if (!compaction.output) {
+    compaction.output = fs::File::openWrite(compaction.target);
+    compaction.output->resize(0);
+  }
+  std::vector<char> buffer(std::min(kCopyChunkSize, io_budget));
+  while (compaction.next < compaction.live.size()) {
+    if (io_budget == 0) return false;
+    const auto& extent = compaction.live[compaction.next];
+    std::span<char> chunk{
+      buffer.data(),
+      std::min({kCopyChunkSize, extent.length - compaction.copied, io_budget})
+    };
+    input.read(extent.offset + compaction.copied, chunk);
+    compaction.output->write(compaction.targets[compaction.next] + compaction.copied, chunk);
+    compaction.copied += chunk.size();
+    io_budget -= chunk.size();
+    if (compaction.copied == extent.length) {
+      ++compaction.next;
+      compaction.copied = 0;
+    }
+  }
+  compaction.output->sync();
+  compaction.output.reset();
+  fs::syncDirectory(compaction.target.parent_path());
+  return true;
+}
+
+// Points the manifest's references into the compacted store at the new store.
+// A manifest with a reference the compaction did not copy (made after the mark)
+// keeps the old store, which the next cycle then finds live; an unreferenced
+// new store is swept by that cycle too.
+void GarbageCollector::relocate(const Compaction& compaction, const fs::Path& directory, std::uint64_t& io_budget) {
+  if (!Manifest::exists(directory)) return;
+  std::uint64_t manifest_size = std::filesystem::file_size(Manifest::path(directory));
+  charge(io_budget, manifest_size);
+  auto manifest = Manifest::load(directory);
+  std::vector<Segment*> references;
+  std::vector<std::size_t> extents;
+  for (auto& entry: manifest.entries) {
+    for (auto& segment: entry.segments) {
+      if (segment.source != SegmentSource::Store) continue;
+      if ((directory / manifest.stores[segment.store]).lexically_normal() != compaction.store) continue;
+      auto it = std::upper_bound(
+        compaction.live.begin(),
+        compaction.live.end(),
+        segment.source_offset,
+        [](std::uint64_t value, const fs::Extent& extent) { return value < extent.offset; }
+      );
+      if (it == compaction.live.begin()) return;
+      --it;
+      if (segment.source_offset + segment.length > it->offset + it->length) return;
+      references.push_back(&segment);
+      extents.push_back(it - compaction.live.begin());
+    }
+  }
+  if (references.empty()) return;
+  std::size_t target = manifest.addStore(compaction.target.lexically_relative(directory));
+  for (std::size_t i = 0; i < references.size(); ++i) {
+    auto& segment = *references[i];
+    const auto& extent = compaction.live[extents[i]];
+    segment.store = target;
+    segment.source_offset = compaction.targets[extents[i]] + (segment.source_offset - extent.offset);
+  }
+  manifest.save(directory);
+  charge(io_budget, manifest_size);
+}
+
+}
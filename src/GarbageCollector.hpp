@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <set>
+#include <vector>
+
+#include "Filesystem.hpp"
+
+
+namespace backups {
+
+// Mark-and-sweep collector for the stores of a backup's restore point directories.
+// Only the directories passed to step() are visited, so the caller decides what
+// the collector may delete. Live ranges are those referenced by committed manifests;
+// directories with a journal belong to restore points still being created and are
+// left alone. Stores without live ranges are deleted, and stores whose live ratio
+// drops below `min_live_ratio` are compacted into a new store.
+//
+// The collector does not run alongside backup operations. It runs in steps taken
+// between them on the same thread, and every phase is charged against the step's
+// I/O budget: manifests read and written, directory entries swept, and bytes
+// copied. Whole manifests are processed, so a step can overshoot its budget by one.
+// Callers must call invalidate() whenever a manifest changes. That restarts an
+// unfinished mark, so a sweep never acts on a stale mark. A compaction that has
+// started carries on, because changes only drop references or move existing ones
+// between manifests. The old store is only swept by a later cycle.
+class GarbageCollector {
+public:
+  explicit GarbageCollector(double min_live_ratio = 0.5);
+
+  // Returns true once a whole collection cycle has finished. A directory may only
+  // be added to `directories` together with a call to invalidate().
+  bool step(std::uint64_t io_budget, const std::vector<fs::Path>& directories);
+  void invalidate();
+
+private:
+  enum class Phase {
+    Idle,
+    Mark,
+    Sweep,
+    Compact
+  };
+
+  struct StoreUsage {
+    std::vector<fs::Extent> live;
+    std::uint64_t live_bytes{0};
+  };
+
+  struct Compaction {
+    fs::Path store;
+    fs::Path target;
+    std::vector<fs::Extent> live;
+    std::vector<std::uint64_t> targets;
+    std::size_t next{0};
+    std::uint64_t copied{0};
+    std::optional<fs::File> output;
+    // Directories whose manifests are still to be pointed at the target, once copied.
+    std::optional<std::vector<fs::Path>> relocating;
+  };
+
+  void mark(const fs::Path& directory, std::uint64_t& io_budget);
+  void mergeLiveRanges();
+  void sweep(const fs::Path& directory, std::uint64_t& io_budget);
+  void plan();
+  bool compact(Compaction& compaction, std::uint64_t& io_budget);
+  void relocate(const Compaction& compaction, const fs::Path& directory, std::uint64_t& io_budget);
+
+private:
+  double min_live_ratio;
+  Phase phase{Phase::Idle};
+  std::vector<fs::Path> pending;
+  std::map<fs::Path, StoreUsage> stores;
+  std::set<fs::Path> pinned;
+  std::deque<Compaction> compactions;
+};
+
+}
@@ -0,0 +1,161 @@
+#include "Journal.hpp"
+
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+
+namespace backups {
+
+namespace {
+
+const char* kJournalName = "journal";
+
+// Appends a partial record to the file's progress, or starts over if the record
+// is for another file or another version of it.
+void applyPartial(std::optional<PartialEntry>& partial, PartialEntry record) {
+  if (
+    !partial
+    || partial->entry.file != record.entry.file
+    || partial->entry.logical_size != record.entry.logical_size
+    || partial->entry.modification_time != record.entry.modification_time
+  ) {
+    partial = std::move(record);
+    return;
+  }
+  for (const auto& segment: record.entry.segments) {
+    partial->entry.addSegment(segment);
+  }
+  partial->resume_offset = record.resume_offset;
+}
+
+}
+
+Journal::Journal(const fs::Path& location)
+  : path(location / kJournalName), file(fs::File::openWrite(location / kJournalName)) {
+  // Commits are only durable once the journal's directory entry is.
+  fs::syncDirectory(location);
+  replay();
+}
+
+bool Journal::exists(const fs::Path& location) {
+  return std::filesystem::exists(location / kJournalName);
+}
+
+const Manifest& Journal::recovered() const {
+  return manifest;
+}
+
+const std::optional<PartialEntry>& Journal::recoveredPartial() const {
+  return partial;
+}
+
+bool Journal::matches(const std::optional<fs::Path>& parent) const {
+  return started && manifest.parent == parent;
+}
+
+void Journal::reset(const std::optional<fs::Path>& parent) {
+  file.resize(0);
+  end = 0;
+  manifest = Manifest{};
+  manifest.parent = parent;
+  partial.reset();
+  started = true;
+  pending.clear();
+  pending_entries = 0;
+  std::ostringstream stream;
+  stream << "parent " << std::quoted(parent ? parent->string() : "-") << '\n';
+  pending += stream.str();
+}
+
+void Journal::recordStore(const fs::Path& store) {
+  std::ostringstream stream;
+  stream << "store " << std::quoted(store.string()) << '\n';
+  pending += stream.str();
+}
+
+void Journal::recordEntry(const ManifestEntry& entry) {
+  std::ostringstream stream;
+  stream << "entry " << entry;
+  pending += stream.str();
+  ++pending_entries;
+}
+
+void Journal::recordPartial(const ManifestEntry& entry, std::uint64_t from, std::uint64_t resume_offset) {
+  ManifestEntry progress{entry.file, entry.logical_size, entry.modification_time, {}};
+  progress.segments = entry.slice(from, resume_offset - from);
+  std::ostringstream stream;
+  stream << "partial " << resume_offset << ' ' << progress;
+  pending += stream.str();
+}
+
+std::size_t Journal::pendingEntries() const {
+  return pending_entries;
+}
+
+void Journal::commit() {
+  if (pending.empty()) return;
+  pending += "commit\n";
+  file.write(end, pending);
+  file.sync();
+  end += pending.size();
+  pending.clear();
+  pending_entries = 0;
+}
+
+void Journal::remove() {
+  std::filesystem::remove(path);
+}
+
+void Journal::replay() {
+  std::string content(file.size(), '\0');
+  file.read(0, content);
+  std::istringstream stream(content);
+  Manifest committed;
+  Manifest uncommitted;
+  std::vector<PartialEntry> uncommitted_partials;
+  bool header = false;
+  std::string record;
+  while (stream >> record) {
+    if (record == "parent") {
+      std::string parent;
+      if (!(stream >> std::quoted(parent))) break;
+      uncommitted.parent = parent == "-" ? std::nullopt : std::optional<fs::Path>(parent);
+      header = true;
+    } else if (record == "store") {
+      std::string store;
+      if (!(stream >> std::quoted(store))) break;
+      uncommitted.stores.push_back(store);
+    } else if (record == "entry") {
+      ManifestEntry entry;
+      if (!(stream >> entry)) break;
+      uncommitted.entries.push_back(std::move(entry));
+    } else if (record == "partial") {
+      PartialEntry progress;
+      if (!(stream >> progress.resume_offset >> progress.entry)) break;
+      uncommitted_partials.push_back(std::move(progress));
+    } else if (record == "commit" && header) {
+      if (stream.get() != '\n') break;
+      committed.parent = uncommitted.parent;
+      committed.stores.insert(committed.stores.end(), uncommitted.stores.begin(), uncommitted.stores.end());
+      for (auto& progress: uncommitted_partials) {
+        applyPartial(partial, std::move(progress));
+      }
+      for (auto& entry: uncommitted.entries) {
+        if (partial && partial->entry.file == entry.file) partial.reset();
+        committed.addEntry(std::move(entry));
+      }
+      uncommitted.stores.clear();
+      uncommitted.entries.clear();
+      uncommitted_partials.clear();
+      started = true;
+      end = stream.tellg();
+    } else {
+      break;
+    }
+  }
+  manifest = std::move(committed);
+  file.resize(end);
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "Filesystem.hpp"
+#include "Manifest.hpp"
+
+
+namespace backups {
+
+// A file whose first `resume_offset` bytes are described by `entry`'s segments.
+struct PartialEntry {
+  ManifestEntry entry;
+  std::uint64_t resume_offset{0};
+};
+
+// Write-ahead log of a restore point that is being created. Records only count
+// once the commit marker that follows them has been synced, so a torn tail left
+// by a crash is dropped when the journal is reopened.
+class Journal {
+public:
+  explicit Journal(const fs::Path& location);
+
+  static bool exists(const fs::Path& location);
+
+  const Manifest& recovered() const;
+  const std::optional<PartialEntry>& recoveredPartial() const;
+  bool matches(const std::optional<fs::Path>& parent) const;
+  void reset(const std::optional<fs::Path>& parent);
+
+  void recordStore(const fs::Path& store);
+  void recordEntry(const ManifestEntry& entry);
+  // Records the segments of `entry` between `from` (the resume offset of its
+  // previous partial record, or zero) and `resume_offset`, so an interrupted run
+  // continues storing the file from `resume_offset`.
+  void recordPartial(const ManifestEntry& entry, std::uint64_t from, std::uint64_t resume_offset);
+  std::size_t pendingEntries() const;
+  void commit();
+  void remove();
+
+private:
+  void replay();
+
+private:
+  fs::Path path;
+  fs::File file;
+  std::uint64_t end{0};
+  bool started{false};
+  Manifest manifest;
+  std::optional<PartialEntry> partial;
+  std::string pending;
+  std::size_t pending_entries{0};
+};
+
+}
@@ -0,0 +1,275 @@
+#include "Manifest.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+
+namespace backups {
+
+namespace {
+
+const char* kManifestName = "manifest";
+
+void expect(std::istream& stream, const std::string& keyword) {
+  std::string word;
+  if (!(stream >> word) || word != keyword) {
+    throw std::runtime_error("Malformed manifest: expected " + keyword);
+  }
+}
+
+}
+
+void ManifestEntry::addSegment(const Segment& segment) {
+  if (!segments.empty()) {
+    auto& last = segments.back();
+    if (
+      last.source == segment.source
+      && last.store == segment.store
+      && last.offset + last.length == segment.offset
+      && last.source_offset + last.length == segment.source_offset
+    ) {
+      last.length += segment.length;
+      return;
+    }
+  }
+  segments.push_back(segment);
+}
+
+std::vector<Segment> ManifestEntry::slice(std::uint64_t offset, std::uint64_t length) const {
+  std::uint64_t end = offset + length;
+  auto it = std::upper_bound(
+    segments.begin(),
+    segments.end(),
+    offset,
+    [](std::uint64_t value, const Segment& segment) { return value < segment.offset; }
+  );
+  if (it != segments.begin()) --it;
+  std::vector<Segment> result;
+  for (; it != segments.end() && it->offset < end; ++it) {
+    std::uint64_t from = std::max(offset, it->offset);
+    std::uint64_t to = std::min(end, it->offset + it->length);
+    if (from >= to) continue;
+    result.push_back(Segment{
+      from,
+      to - from,
+      it->source,
+      it->store,
+      it->source_offset + (from - it->offset)
+    });
+  }
+  return result;
+}
+
+std::ostream& operator<<(std::ostream& stream, const ManifestEntry& entry) {
+  stream << std::quoted(entry.file.string()) << ' '
+    << entry.logical_size << ' '
+    << entry.modification_time << ' '
+    << entry.segments.size() << '\n';
+  for (const auto& segment: entry.segments) {
+    if (segment.source == SegmentSource::Store) {
+      stream << "s " << segment.store << ' ';
+    } else {
+      stream << "p ";
+    }
+    stream << segment.offset << ' ' << segment.length << ' ' << segment.source_offset << '\n';
+  }
+  return stream;
+}
+
+std::istream& operator>>(std::istream& stream, ManifestEntry& entry) {
+  std::string file;
+  std::size_t segment_count = 0;
+  if (!(stream >> std::quoted(file) >> entry.logical_size >> entry.modification_time >> segment_count)) {
+    return stream;
+  }
+  entry.file = file;
+  entry.segments.clear();
+  for (std::size_t i = 0; i < segment_count; ++i) {
+    std::string kind;
+    Segment segment{0, 0, SegmentSource::Parent, 0, 0};
+    stream >> kind;
+    if (kind == "s") {
+      segment.source = SegmentSource::Store;
+      stream >> segment.store;
+    } else if (kind != "p") {
+      stream.setstate(std::ios::failbit);
+      return stream;
+    }
+    stream >> segment.offset >> segment.length >> segment.source_offset;
+    entry.segments.push_back(segment);
+  }
+  return stream;
+}
+
+fs::Path Manifest::path(const fs::Path& location) {
+  return location / kManifestName;
+}
+
+bool Manifest::exists(const fs::Path& location) {
+  return std::filesystem::exists(path(location));
+}
+
+void Manifest::remove(const fs::Path& location) {
+  std::filesystem::remove(path(location));
+  fs::syncDirectory(location);
+}
+
+Manifest Manifest::load(const fs::Path& location) {
+  std::ifstream stream(path(location));
+  if (!stream) {
+    throw std::runtime_error("Could not open manifest of " + location.string());
+  }
+  Manifest manifest;
+  std::string parent;
+  std::size_t count = 0;
+  expect(stream, "parent");
+  stream >> std::quoted(parent);
+  if (parent != "-") manifest.parent = parent;
+  expect(stream, "stores");
+  stream >> count;
+  for (std::size_t i = 0; i < count; ++i) {
+    std::string store;
+    stream >> std::quoted(store);
+    manifest.stores.push_back(store);
+  }
+  expect(stream, "entries");
+  stream >> count;
+  manifest.entries.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    ManifestEntry entry;
+    stream >> entry;
+    manifest.addEntry(std::move(entry));
+  }
+  if (!stream) {
+    throw std::runtime_error("Malformed manifest of " + location.string());
+  }
+  return manifest;
+}
+
+void Manifest::save(const fs::Path& location) const {
+  std::ostringstream stream;
+  stream << "parent " << std::quoted(parent ? parent->string() : "-") << '\n';
+  stream << "stores " << stores.size() << '\n';
+  for (const auto& store: stores) {
+    stream << std::quoted(store.string()) << '\n';
+  }
+  stream << "entries " << entries.size() << '\n';
+  for (const auto& entry: entries) {
+    stream << entry;
+  }
+  fs::replaceFile(path(location), stream.str());
+}
+
+const ManifestEntry* Manifest::find(const fs::Path& file) const {
+  auto it = index.find(file.string());
+  return it == index.end() ? nullptr : &entries[it->second];
+}
+
+void Manifest::addEntry(ManifestEntry entry) {
+  index.emplace(entry.file.string(), entries.size());
+  entries.push_back(std::move(entry));
+}
+
+std::size_t Manifest::addStore(const fs::Path& store) {
+  auto it = std::find(stores.begin(), stores.end(), store);
+  if (it != stores.end()) return it - stores.begin();
+  stores.push_back(store);
+  return stores.size() - 1;
+}
+
+StorageSize Manifest::size() const {
+  StorageSize size;
+  for (const auto& entry: entries) {
+    size.logical += entry.logical_size;
+    for (const auto& segment: entry.segments) {
+      if (segment.source == SegmentSource::Store) size.physical += segment.length;
+    }
+  }
+  return size;
+}
+
+ManifestChain::ManifestChain(const fs::Path& location) {
+  chain.emplace_back(location, Manifest::load(location));
+}
+
+const Manifest& ManifestChain::root() const {
+  return chain.front().second;
+}
+
+std::vector<ResolvedSegment> ManifestChain::resolve(
+  const fs::Path& file,
+  std::uint64_t offset,
+  std::uint64_t length
+) {
+  std::vector<ResolvedSegment> resolved;
+  resolve(0, file, offset, length, offset, resolved);
+  return resolved;
+}
+
+const std::pair<fs::Path, Manifest>& ManifestChain::at(std::size_t level) {
+  while (chain.size() <= level) {
+    const auto& parent = chain.back().second.parent;
+    if (!parent) {
+      throw std::runtime_error("Restore point " + chain.back().first.string() + " has no parent");
+    }
+    fs::Path location = *parent;
+    chain.emplace_back(location, Manifest::load(location));
+  }
+  return chain[level];
+}
+
+const ManifestEntry& ManifestChain::entryAt(std::size_t level, const fs::Path& file) {
+  if (file != cached_file) {
+    cached_file = file;
+    cached_entries.clear();
+  }
+  if (cached_entries.size() <= level) {
+    cached_entries.resize(level + 1, nullptr);
+  }
+  if (!cached_entries[level]) {
+    const auto& [location, manifest] = at(level);
+    cached_entries[level] = manifest.find(file);
+    if (!cached_entries[level]) {
+      throw std::runtime_error("Could not find " + file.string() + " in " + location.string());
+    }
+  }
+  return *cached_entries[level];
+}
+
+void ManifestChain::resolve(
+  std::size_t level,
+  const fs::Path& file,
+  std::uint64_t offset,
+  std::uint64_t length,
+  std::uint64_t base,
+  std::vector<ResolvedSegment>& resolved
+) {
+  const ManifestEntry& entry = entryAt(level, file);
+  const auto& [location, manifest] = at(level);
+  for (const auto& segment: entry.slice(offset, length)) {
+    std::uint64_t target = base + (segment.offset - offset);
+    if (segment.source == SegmentSource::Parent) {
+      resolve(level + 1, file, segment.source_offset, segment.length, target, resolved);
+      continue;
+    }
+    fs::Path store = (location / manifest.stores[segment.store]).lexically_normal();
+    if (!resolved.empty()) {
+      auto& last = resolved.back();
+      if (
+        last.store == store
+        && last.offset + last.length == target
+        && last.source_offset + last.length == segment.source_offset
+      ) {
+        last.length += segment.length;
+        continue;
+      }
+    }
+    resolved.push_back(ResolvedSegment{target, segment.length, std::move(store), segment.source_offset});
+  }
+}
+
+}
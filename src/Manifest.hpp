@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Filesystem.hpp"
+#include "RestorePoint.hpp"
+
+
+namespace backups {
+
+enum class SegmentSource {
+  Store,
+  Parent
+};
+
+// A run of file data: either bytes kept in one of the restore point's stores,
+// or a range of the same file as it was in the parent restore point.
+struct Segment {
+  std::uint64_t offset;
+  std::uint64_t length;
+  SegmentSource source;
+  std::size_t store;
+  std::uint64_t source_offset;
+};
+
+struct ManifestEntry {
+  fs::Path file;
+  std::uint64_t logical_size{0};
+  std::int64_t modification_time{0};
+  // Sorted by offset; ranges not covered by any segment are holes.
+  std::vector<Segment> segments;
+
+  void addSegment(const Segment& segment);
+  std::vector<Segment> slice(std::uint64_t offset, std::uint64_t length) const;
+};
+
+std::ostream& operator<<(std::ostream& stream, const ManifestEntry& entry);
+std::istream& operator>>(std::istream& stream, ManifestEntry& entry);
+
+struct Manifest {
+  std::optional<fs::Path> parent;
+  std::vector<fs::Path> stores;
+  std::vector<ManifestEntry> entries;
+
+  static fs::Path path(const fs::Path& location);
+  static bool exists(const fs::Path& location);
+  static void remove(const fs::Path& location);
+  static Manifest load(const fs::Path& location);
+  void save(const fs::Path& location) const;
+
+  const ManifestEntry* find(const fs::Path& file) const;
+  void addEntry(ManifestEntry entry);
+  std::size_t addStore(const fs::Path& store);
+  StorageSize size() const;
+
+private:
+  // Position in `entries` by file path; kept up to date by addEntry.
+  std::unordered_map<std::string, std::size_t> index;
+};
+
+struct ResolvedSegment {
+  std::uint64_t offset;
+  std::uint64_t length;
+  fs::Path store;
+  std::uint64_t source_offset;
+};
+
+// Manifests of a restore point and its ancestors, loaded as parent references are followed.
+class ManifestChain {
+public:
+  explicit ManifestChain(const fs::Path& location);
+
+  const Manifest& root() const;
+
+  std::vector<ResolvedSegment> resolve(const fs::Path& file, std::uint64_t offset, std::uint64_t length);
+
+private:
+  const std::pair<fs::Path, Manifest>& at(std::size_t level);
+  const ManifestEntry& entryAt(std::size_t level, const fs::Path& file);
+  void resolve(
+    std::size_t level,
+    const fs::Path& file,
+    std::uint64_t offset,
+    std::uint64_t length,
+    std::uint64_t base,
+    std::vector<ResolvedSegment>& resolved
+  );
+
+private:
+  std::deque<std::pair<fs::Path, Manifest>> chain;
+  fs::Path cached_file;
+  std::vector<const ManifestEntry*> cached_entries;
+};
+
+}
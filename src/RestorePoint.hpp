@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -10,13 +11,35 @@
 
 namespace backups {
 
+// `logical` is the apparent size of the files; `physical` is the store bytes their
+// data references. Space is not reclaimed immediately: a store is compacted only
+// once less than half of it is live, and unreferenced stores wait for the next
+// sweep. Disk usage can therefore reach about twice `physical`; see
+// fs::diskUsage for what is actually allocated.
+struct StorageSize {
+  std::uint64_t logical{0};
+  std::uint64_t physical{0};
+
+  StorageSize& operator+=(const StorageSize& other) {
+    logical += other.logical;
+    physical += other.physical;
+    return *this;
+  }
+
+  StorageSize& operator-=(const StorageSize& other) {
+    logical -= other.logical;
+    physical -= other.physical;
+    return *this;
+  }
+};
+
 struct RestorePoint {
   Id id;
   time::DateTime creation_time;
   fs::Path location;
   bool is_incremental;
   std::vector<fs::Path> files;
-  std::size_t size;
+  StorageSize size;
 };
 
 }
@@ -1,6 +1,8 @@
 #include "RestorePointLimit.hpp"
 
+#include <algorithm>
 #include <sstream>
+#include <stdexcept>
 
 
 namespace backups {
@@ -12,13 +14,17 @@ std::string RPLBySize::getDescription() const {
 std::size_t RPLBySize::badPrefixSize(const std::deque<RestorePoint>& restore_points) {
   std::size_t suffix_size = 0;
   for (auto it = restore_points.rbegin(); it != restore_points.rend(); ++it) {
-    suffix_size += it->size;
+    suffix_size += it->size.physical;
     if (suffix_size <= size) continue;
     return restore_points.rend() - it;
   }
   return 0;
 }
 
+void RPLBySize::save(std::ostream& stream) const {
+  stream << "size " << size;
+}
+
 std::string RPLByNumber::getDescription() const {
   return (std::stringstream{} << "[by number: " << count << "]").str();
 }
@@ -27,6 +33,10 @@ std::size_t RPLByNumber::badPrefixSize(const std::deque<RestorePoint>& restore_p
   return restore_points.size() <= count ? 0 : restore_points.size() - count;
 }
 
+void RPLByNumber::save(std::ostream& stream) const {
+  stream << "number " << count;
+}
+
 std::string RPLByTime::getDescription() const {
   return (std::stringstream{} << "[by time: " << period.count() << "]").str();
 }
@@ -40,6 +50,10 @@ std::size_t RPLByTime::badPrefixSize(const std::deque<RestorePoint>& restore_poi
   return 0;
 }
 
+void RPLByTime::save(std::ostream& stream) const {
+  stream << "time " << period.count();
+}
+
 std::string RPLHybrid::getDescription() const {
   std::stringstream ss;
   ss << "[";
@@ -67,4 +81,46 @@ std::size_t RPLHybrid::badPrefixSize(const std::deque<RestorePoint>& restore_poi
   }
 }
 
+void RPLHybrid::save(std::ostream& stream) const {
+  stream << "hybrid " << (delete_rule == CombinationRule::All ? "all" : "any") << ' ' << limits.size();
+  for (const auto& limit: limits) {
+    stream << ' ';
+    limit->save(stream);
+  }
+}
+
+std::unique_ptr<IRestorePointLimit> loadRestorePointLimit(std::istream& stream) {
+  std::string kind;
+  stream >> kind;
+  if (kind == "size") {
+    auto limit = std::make_unique<RPLBySize>();
+    stream >> limit->size;
+    return limit;
+  } else if (kind == "number") {
+    auto limit = std::make_unique<RPLByNumber>();
+    stream >> limit->count;
+    return limit;
+  } else if (kind == "time") {
+    auto limit = std::make_unique<RPLByTime>();
+    time::Duration::rep period = 0;
+    stream >> period;
+    limit->period = time::Duration{period};
+    return limit;
+  } else if (kind == "hybrid") {
+    auto limit = std::make_unique<RPLHybrid>();
+    std::string rule;
+    std::size_t count = 0;
+    stream >> rule >> count;
+    if (rule != "any" && rule != "all") {
+      throw std::runtime_error("Unsupported combination rule " + rule);
+    }
+    limit->delete_rule = rule == "all" ? CombinationRule::All : CombinationRule::Any;
+    for (std::size_t i = 0; i < count && stream; ++i) {
+      limit->limits.push_back(loadRestorePointLimit(stream));
+    }
+    return limit;
+  }
+  throw std::runtime_error("Unsupported restore point limit " + kind);
+}
+
 }
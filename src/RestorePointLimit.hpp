@@ -1,5 +1,6 @@
 #pragma once
 
+#include <iosfwd>
 #include <vector>
 #include <memory>
 #include <deque>
@@ -18,14 +19,23 @@ struct IRestorePointLimit {
     virtual std::string getDescription() const = 0;
 
     virtual std::size_t badPrefixSize(const std::deque<RestorePoint>& restore_points) = 0;
+
+    // Writes the limit in the form read back by loadRestorePointLimit.
+    virtual void save(std::ostream& stream) const = 0;
 };
 
+std::unique_ptr<IRestorePointLimit> loadRestorePointLimit(std::istream& stream);
+
+// Limits the physical size of the newest restore points. That is their live
+// store bytes, not disk usage, which also includes data not yet collected.
 struct RPLBySize: public IRestorePointLimit {
   std::size_t size = std::numeric_limits<std::size_t>::max();
 
   std::string getDescription() const override;
 
   std::size_t badPrefixSize(const std::deque<RestorePoint>& restore_points) override;
+
+  void save(std::ostream& stream) const override;
 };
 
 struct RPLByNumber: public IRestorePointLimit {
@@ -34,6 +44,8 @@ struct RPLByNumber: public IRestorePointLimit {
   std::string getDescription() const override;
 
   std::size_t badPrefixSize(const std::deque<RestorePoint>& restore_points) override;
+
+  void save(std::ostream& stream) const override;
 };
 
 struct RPLByTime: public IRestorePointLimit {
@@ -42,6 +54,8 @@ struct RPLByTime: public IRestorePointLimit {
   std::string getDescription() const override;
 
   std::size_t badPrefixSize(const std::deque<RestorePoint>& restore_points) override;
+
+  void save(std::ostream& stream) const override;
 };
 
 enum class CombinationRule {
@@ -56,6 +70,8 @@ struct RPLHybrid: public IRestorePointLimit {
   std::string getDescription() const override;
 
   std::size_t badPrefixSize(const std::deque<RestorePoint>& restore_points) override;
+
+  void save(std::ostream& stream) const override;
 };
 
 }